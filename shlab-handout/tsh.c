@@ -19,6 +19,10 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <errno.h>
 
 /* Misc manifest constants */
@@ -26,6 +30,11 @@
 #define MAXARGS     128   /* max args on a command line */
 #define MAXJOBS      16   /* max jobs at any point in time */
 #define MAXJID    1<<16   /* max job ID */
+#define MAXNODES     64   /* max nodes in the dependency graph */
+#define MAXPREREQ    16   /* max prerequisites of a single node */
+#define MAXNAME      32   /* max length of a dag target name */
+#define DAGSLOTS      4   /* default max dag nodes running at once */
+#define MAXTREE    1024   /* max processes in the tree of one job */
 
 /* Job states */
 #define UNDEF 0 /* undefined */
@@ -43,10 +52,25 @@
  * At most 1 job can be in the FG state.
  */
 
+/* Dependency node states */
+#define NFREE 0 /* unused node */
+#define NWAIT 1 /* waiting for prerequisites or a free slot */
+#define NRUN  2 /* started by the scheduler, running as a BG job */
+#define NJOB  3 /* an existing job that other nodes wait for */
+
+/*
+ * Node state transitions and enabling actions:
+ *     NWAIT -> NRUN  : all prerequisites finished and a slot is free
+ *     NRUN  -> NFREE : job reaped, dependents are released or cancelled
+ *     NJOB  -> NFREE : job reaped, dependents are released or cancelled
+ * A node only succeeds if its job exits normally with status 0.
+ */
+
 /* Global variables */
 extern char **environ;      /* defined in libc */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;            /* if true, print additional output */
+int subreaper = 0;          /* if true, we adopt orphaned descendants */
 int nextjid = 1;            /* next job ID to allocate */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
 
@@ -58,8 +82,34 @@ struct job_t                /* The job struct */
 	int jid;                /* job ID [1, 2, ...] */
 	int state;              /* UNDEF, BG, FG, or ST */
 	char cmdline[MAXLINE];  /* command line */
+	int reaped;             /* leader reaped, rest of the tree still alive */
+	int status;             /* wait status of the leader once reaped */
+	long cputime;           /* CPU usecs used by reaped processes of the job */
 };
 struct job_t jobs[MAXJOBS]; /* The job list */
+
+struct proc_t               /* A process found in /proc */
+{
+	pid_t pid;              /* process ID */
+	pid_t ppid;             /* parent process ID */
+	pid_t pgid;             /* process group ID */
+	long ticks;             /* CPU clock ticks used by it and its children */
+	int intree;             /* true if it belongs to the job being scanned */
+};
+
+struct node_t               /* The dependency graph node struct */
+{
+	int state;              /* NFREE, NWAIT, NRUN or NJOB */
+	pid_t pid;              /* job PID once started */
+	int nwait;              /* number of unfinished prerequisites */
+	int pre[MAXPREREQ];     /* prerequisite nodes, -1 once finished */
+	char name[MAXNAME];     /* dag target name, empty for after */
+	char cmdline[MAXLINE];  /* command line, empty for phony targets */
+	char buf[MAXLINE];      /* storage for the argv strings */
+	char *argv[MAXARGS];    /* argument list of the command */
+};
+struct node_t nodes[MAXNODES]; /* The dependency graph */
+int dagslots = DAGSLOTS;    /* max scheduled nodes running at once */
 /* End global variables */
 
 
@@ -69,6 +119,9 @@ struct job_t jobs[MAXJOBS]; /* The job list */
 void eval(char *cmdline);
 int builtin_cmd(char **argv);
 void do_bgfg(char **argv);
+void do_after(char **argv);
+void do_dag(char **argv);
+void do_kill(char **argv);
 void waitfg(pid_t pid);
 
 void sigchld_handler(int sig);
@@ -87,8 +140,25 @@ int deletejob(struct job_t *jobs, pid_t pid);
 pid_t fgpid(struct job_t *jobs);
 struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
 struct job_t *getjobjid(struct job_t *jobs, int jid);
+struct job_t *getjobarg(char *cmd, char *arg);
 int pid2jid(pid_t pid);
-void listjobs(struct job_t *jobs);
+void listjobs(struct job_t *jobs, int lflag);
+void finishjob(struct job_t *job, int status);
+void checktrees(void);
+
+int readstat(pid_t pid, struct proc_t *proc);
+int scantree(struct job_t *job, struct proc_t *tree, int max);
+void killtree(struct job_t *job, int sig);
+
+int addnode(char *name, char **argv);
+void setnodeargv(int node, char **argv);
+int watchjob(pid_t pid);
+int addprereq(int node, int pre);
+void freenode(int node);
+void startnode(int node);
+void finishnode(int node, int ok);
+void schedulenodes(void);
+void nodereaped(pid_t pid, int status);
 
 void usage(void);
 void unix_error(char *msg);
@@ -110,7 +180,7 @@ int main(int argc, char **argv)
 	dup2(1, 2);
 
 	/* Parse the command line */
-	while ((c = getopt(argc, argv, "hvp")) != EOF)
+	while ((c = getopt(argc, argv, "hvps")) != EOF)
 	{
 		switch (c)
 		{
@@ -123,6 +193,9 @@ int main(int argc, char **argv)
 			case 'p':             /* don't print a prompt */
 				emit_prompt = 0;  /* handy for automatic testing */
 				break;
+			case 's':             /* adopt orphaned descendants of jobs */
+				subreaper = 1;
+				break;
 			default:
 				usage();
 		}
@@ -138,6 +211,13 @@ int main(int argc, char **argv)
 	/* This one provides a clean way to kill the shell */
 	Signal(SIGQUIT, sigquit_handler);
 
+	/* Orphans of our jobs are reparented to us instead of init, so
+	 * a job lives until its whole process tree is gone */
+	if (subreaper && prctl(PR_SET_CHILD_SUBREAPER, 1) < 0)
+	{
+		unix_error("prctl error");
+	}
+
 	/* Initialize the job list */
 	initjobs(jobs);
 
@@ -361,14 +441,14 @@ int builtin_cmd(char **argv)
 	if (!strcmp(argv[0], "quit"))       //check for built in cmd quit
 	{
 		// When the shell terminates it should terminate all it child process
-		// So we get all the process ids from the job list and kill it with SIGTERM.
+		// So we get all the process trees from the job list and kill them with SIGTERM.
 		if (sizeof(jobs) > 0)
 		{
 			for (i = 0; i < MAXJOBS; i++)
 			{
 				if (jobs[i].pid != 0)
 				{
-					kill(-(jobs[i].pid), SIGTERM);
+					killtree(&jobs[i], SIGTERM);
 				}
 			}
 		}
@@ -378,16 +458,32 @@ int builtin_cmd(char **argv)
 	}
 	else if (!strcmp(argv[0], "jobs"))  // lists all background jobs
 	{
-		listjobs(jobs);
+		// jobs -l also shows the process count and CPU time of each job
+		listjobs(jobs, argv[1] != NULL && !strcmp(argv[1], "-l"));
 
 		return 1;
 	}
+	else if (!strcmp(argv[0], "kill"))
+	{
+		do_kill(argv);
+		return 1;
+	}
 	else if (!strcmp(argv[0], "fg") || !strcmp(argv[0], "bg") )
 	{
 		// If our built in command is fg or bg we go straight to do_bgfg()
 		do_bgfg(argv);
 		return 1;
 	}
+	else if (!strcmp(argv[0], "after"))
+	{
+		do_after(argv);
+		return 1;
+	}
+	else if (!strcmp(argv[0], "dag"))
+	{
+		do_dag(argv);
+		return 1;
+	}
 
 	return 0;     /* not a builtin command */
 }
@@ -492,12 +588,323 @@ void do_bgfg(char **argv)
 	return;
 }
 
+/*
+ * do_after - Execute the builtin after command
+ *
+ * "after %1 %2 -- cmd" starts cmd as a background job as soon as every
+ * listed job (PID or %jobid) has exited with status 0. If one of them
+ * fails instead, cmd is cancelled without ever running.
+ */
+void do_after(char **argv)
+{
+	int i, j, node;
+	pid_t pids[MAXPREREQ]; // PIDs of the jobs we wait for
+	struct job_t *job;
+	sigset_t mask;
+
+	// Find the "--" that separates the jobs from the command
+	for (i = 1; argv[i] != NULL && strcmp(argv[i], "--"); i++)
+	{
+		;
+	}
+	if (i == 1 || argv[i] == NULL || argv[i + 1] == NULL)
+	{
+		printf("Usage: after <PID|%%jobid>... -- command\n");
+		fflush(stdout);
+		return;
+	}
+	if (i - 1 > MAXPREREQ)
+	{
+		printf("after: too many prerequisites\n");
+		fflush(stdout);
+		return;
+	}
+
+	// Block SIGCHLD so none of the jobs can be reaped while
+	// we hook the new node up to them.
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	// Resolve every argument before adding anything
+	for (j = 1; j < i; j++)
+	{
+		if ((job = getjobarg(argv[0], argv[j])) == NULL)
+		{
+			break;
+		}
+		pids[j - 1] = job->pid;
+	}
+
+	if (j == i && (node = addnode("", &argv[i + 1])) >= 0)
+	{
+		for (j = 0; j < i - 1; j++)
+		{
+			addprereq(node, watchjob(pids[j]));
+		}
+		nodes[node].state = NWAIT;
+		schedulenodes();
+	}
+
+	fflush(stdout);
+	sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	return;
+}
+
+/*
+ * do_dag - Execute the builtin dag command
+ *
+ * "dag [-j slots] file" loads a make-like dependency graph and runs it.
+ * Every target line "name: dep1 dep2" may be followed by one indented
+ * command line. A target starts once all its dependencies succeeded
+ * and at most slots targets run at the same time.
+ */
+void do_dag(char **argv)
+{
+	FILE *fp;
+	char line[MAXLINE];
+	char *p, *colon, *name;
+	char *cargv[MAXARGS];
+	static char deps[MAXNODES][MAXLINE]; // dependency list of each target
+	int ids[MAXNODES];   // nodes created by this file
+	int queue[MAXNODES]; // for the cycle check
+	int indeg[MAXNODES];
+	int n = 0, i, j, k, head, tail, lineno = 0, err = 0;
+	char *file = argv[1];
+	sigset_t mask;
+
+	if (argv[1] != NULL && !strcmp(argv[1], "-j"))
+	{
+		if (argv[2] == NULL || (k = atoi(argv[2])) < 1)
+		{
+			printf("dag: -j requires a positive number of slots\n");
+			fflush(stdout);
+			return;
+		}
+		dagslots = k;
+		file = argv[3];
+	}
+	if (file == NULL)
+	{
+		printf("Usage: dag [-j slots] file\n");
+		fflush(stdout);
+		return;
+	}
+	if ((fp = fopen(file, "r")) == NULL)
+	{
+		printf("dag: %s: %s\n", file, strerror(errno));
+		fflush(stdout);
+		return;
+	}
+
+	// Nothing may be scheduled until the whole graph is in place
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	while (!err && fgets(line, MAXLINE - 1, fp) != NULL)
+	{
+		lineno++;
+		if (line[strlen(line) - 1] != '\n')
+		{
+			strcat(line, "\n"); // parseline wants the newline
+		}
+		for (p = line; *p == ' ' || *p == '\t'; p++)
+		{
+			;
+		}
+		if (*p == '\n' || *p == '#')
+		{
+			continue;
+		}
+
+		// An indented line is the command of the last target
+		if (p != line)
+		{
+			if (n == 0 || nodes[ids[n - 1]].argv[0] != NULL)
+			{
+				printf("dag: %s:%d: command without a target\n", file, lineno);
+				err = 1;
+				break;
+			}
+			parseline(p, cargv);
+			setnodeargv(ids[n - 1], cargv);
+			continue;
+		}
+
+		if ((colon = strchr(p, ':')) == NULL)
+		{
+			printf("dag: %s:%d: missing ':'\n", file, lineno);
+			err = 1;
+			break;
+		}
+		*colon = '\0';
+		name = strtok(p, " \t");
+		if (name == NULL || strtok(NULL, " \t") != NULL)
+		{
+			printf("dag: %s:%d: bad target name\n", file, lineno);
+			err = 1;
+			break;
+		}
+		for (i = 0; i < n; i++)
+		{
+			if (!strcmp(nodes[ids[i]].name, name))
+			{
+				printf("dag: %s:%d: duplicate target %s\n", file, lineno, name);
+				err = 1;
+			}
+		}
+		if (err || n == MAXNODES || (ids[n] = addnode(name, NULL)) < 0)
+		{
+			err = 1;
+			break;
+		}
+		strcpy(deps[n++], colon + 1);
+	}
+	fclose(fp);
+
+	// Link every target to its dependencies
+	for (k = 0; !err && k < n; k++)
+	{
+		for (name = strtok(deps[k], " \t\n"); name; name = strtok(NULL, " \t\n"))
+		{
+			for (i = 0; i < n && strcmp(nodes[ids[i]].name, name); i++)
+			{
+				;
+			}
+			if (i == n)
+			{
+				printf("dag: %s: unknown target %s\n", file, name);
+				err = 1;
+				break;
+			}
+			if (!addprereq(ids[k], ids[i]))
+			{
+				printf("dag: %s: too many prerequisites for %s\n", file, nodes[ids[k]].name);
+				err = 1;
+				break;
+			}
+		}
+	}
+
+	// A cycle would leave its targets waiting forever, so reject it:
+	// peel off targets without pending dependencies until none are left.
+	if (!err)
+	{
+		head = tail = 0;
+		for (k = 0; k < n; k++)
+		{
+			if ((indeg[k] = nodes[ids[k]].nwait) == 0)
+			{
+				queue[tail++] = k;
+			}
+		}
+		while (head < tail)
+		{
+			i = queue[head++];
+			for (k = 0; k < n; k++)
+			{
+				for (j = 0; j < MAXPREREQ; j++)
+				{
+					if (nodes[ids[k]].pre[j] == ids[i] && --indeg[k] == 0)
+					{
+						queue[tail++] = k;
+					}
+				}
+			}
+		}
+		if (tail < n)
+		{
+			printf("dag: %s: dependency cycle\n", file);
+			err = 1;
+		}
+	}
+
+	for (k = 0; k < n; k++)
+	{
+		if (err)
+		{
+			freenode(ids[k]);
+		}
+		else
+		{
+			nodes[ids[k]].state = NWAIT;
+		}
+	}
+	if (!err)
+	{
+		schedulenodes();
+	}
+
+	fflush(stdout);
+	sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	return;
+}
+
+/*
+ * do_kill - Execute the builtin kill command
+ *
+ * "kill [-signo] <PID|%jobid>" sends a signal (SIGTERM by default) to
+ * every process in the tree of the job, including descendants that
+ * moved to a process group of their own.
+ */
+void do_kill(char **argv)
+{
+	int sig = SIGTERM;
+	char **arg = &argv[1];
+	char *endptr;
+	struct job_t *job;
+	sigset_t mask;
+
+	if (*arg != NULL && (*arg)[0] == '-')
+	{
+		sig = strtol(&(*arg)[1], &endptr, 10);
+		if (endptr[0] != 0 || sig < 1 || sig >= NSIG)
+		{
+			printf("kill: %s: invalid signal\n", *arg);
+			fflush(stdout);
+			return;
+		}
+		arg++;
+	}
+	if (*arg == NULL)
+	{
+		printf("%s command requires PID or %%jobid argument\n", argv[0]);
+		fflush(stdout);
+		return;
+	}
+
+	// Keep the job from being reaped and reused while we walk its tree
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	if ((job = getjobarg(argv[0], *arg)) != NULL)
+	{
+		killtree(job, sig);
+
+		// A stopped job would not act on the signal until continued
+		if (job->state == ST && sig != SIGSTOP && sig != SIGTSTP && sig != SIGCONT)
+		{
+			killtree(job, SIGCONT);
+		}
+	}
+
+	fflush(stdout);
+	sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	return;
+}
+
 /*
  * waitfg - Block until process pid is no longer the foreground process
  */
 void waitfg(pid_t pid)
 {
 	struct job_t *job;
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
 
 	job = getjobpid(jobs, pid); // Return job struct
 
@@ -505,6 +912,11 @@ void waitfg(pid_t pid)
 	while (job->state == FG)
 	{
 		sleep(1); // wait one second
+
+		// The rest of the tree may have been reaped by someone else
+		sigprocmask(SIG_BLOCK, &mask, NULL);
+		checktrees();
+		sigprocmask(SIG_UNBLOCK, &mask, NULL);
 	}
 	return;
 }
@@ -524,6 +936,9 @@ void sigchld_handler(int sig)
 {
 	pid_t pid;
 	int status;
+	siginfo_t info;
+	struct rusage usage;
+	struct proc_t proc;
 	struct job_t *jobid;
 	/* bls 725 og bls 727-728
 	. WIFEXITED(status): Returns true if the child terminated normally, via a
@@ -546,32 +961,60 @@ void sigchld_handler(int sig)
 	    to stop. This status is only deﬁned if WIFSTOPPED(status) returned true. <- ekki athuga
 	 */
 
-	while ((pid = waitpid(-1, &status, WUNTRACED | WNOHANG)) > 0)
+	// Peek at the next child without reaping it, so an adopted
+	// descendant can still be matched to its job through /proc
+	info.si_pid = 0;
+	while (waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WNOHANG | WNOWAIT) == 0 && info.si_pid > 0)
 	{
-		jobid = getjobpid(jobs, pid); // Return job struct
+		pid = info.si_pid;
+		info.si_pid = 0;
 
-		// If user hits ctrl+c or the process terminates suddenly
-		// we should print it out and delete the job
-		if (WIFSIGNALED(status))
+		jobid = getjobpid(jobs, pid); // Return job struct
+		if (jobid == NULL && readstat(pid, &proc))
 		{
-			printf("Job [%d] (%d) terminated by signal %d\n", jobid->jid, pid, WTERMSIG(status));
-			fflush(stdout);
-			deletejob(jobs, pid); // Remove job from the jobs list
+			jobid = getjobpid(jobs, proc.pgid);
+		}
+		if (wait4(pid, &status, WUNTRACED | WNOHANG, &usage) <= 0)
+		{
+			break;
 		}
+		if (jobid == NULL)   // Not part of any job
+		{
+			continue;
+		}
+
 		// If user hits ctrl+z or the process gets SIGTSTP
 		// we but it in ST state and print out info.
-		else if (WIFSTOPPED(status))
+		if (WIFSTOPPED(status))
 		{
-			jobid->state = ST; // Put it in ST (stop) state
-			printf("Job [%d] (%d) stopped by signal %d\n", jobid->jid, pid, WSTOPSIG(status));
-			fflush(stdout);
+			if (jobid->pid == pid || (jobid->reaped && jobid->state != ST))
+			{
+				jobid->state = ST; // Put it in ST (stop) state
+				printf("Job [%d] (%d) stopped by signal %d\n", jobid->jid, jobid->pid, WSTOPSIG(status));
+				fflush(stdout);
+			}
+			continue;
 		}
-		// Just a normal exit or not implemented so we just delete the job
-		else
+
+		jobid->cputime += usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec;
+		jobid->cputime += usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec;
+
+		// When the leader is gone the job only ends with the rest of
+		// its tree, the adopted descendants are handled by checktrees()
+		if (jobid->pid == pid)
 		{
-			deletejob(jobs, pid); // Remove job from the jobs list
+			if (subreaper && kill(-pid, 0) == 0)
+			{
+				jobid->reaped = 1;
+				jobid->status = status;
+			}
+			else
+			{
+				finishjob(jobid, status);
+			}
 		}
 	}
+	checktrees();
 
 	return;
 }
@@ -636,6 +1079,9 @@ void clearjob(struct job_t *job)
 	job->jid = 0;
 	job->state = UNDEF;
 	job->cmdline[0] = '\0';
+	job->reaped = 0;
+	job->status = 0;
+	job->cputime = 0;
 }
 
 /* initjobs - Initialize the job list */
@@ -686,6 +1132,9 @@ int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline)
 				nextjid = 1;
 			}
 			strcpy(jobs[i].cmdline, cmdline);
+			jobs[i].reaped = 0;
+			jobs[i].status = 0;
+			jobs[i].cputime = 0;
 			if (verbose)
 			{
 				printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
@@ -772,6 +1221,44 @@ struct job_t *getjobjid(struct job_t *jobs, int jid)
 	return NULL;
 }
 
+/*
+ * getjobarg - Find the job named by a PID or %jobid argument of
+ *    builtin cmd, prints what went wrong and returns NULL if none
+ */
+struct job_t *getjobarg(char *cmd, char *arg)
+{
+	struct job_t *job;
+	char *endptr;
+	long id;
+
+	if (arg[0] == '%')
+	{
+		id = strtol(&arg[1], &endptr, 10);
+		if (endptr[0] != 0 || endptr == &arg[1])
+		{
+			printf("%s: argument must be a PID or %%jobid\n", cmd);
+			return NULL;
+		}
+		if ((job = getjobjid(jobs, id)) == NULL)
+		{
+			printf("%%%ld: No such job\n", id);
+		}
+		return job;
+	}
+
+	id = strtol(arg, &endptr, 10);
+	if (endptr[0] != 0 || endptr == arg)
+	{
+		printf("%s: argument must be a PID or %%jobid\n", cmd);
+		return NULL;
+	}
+	if ((job = getjobpid(jobs, id)) == NULL)
+	{
+		printf("(%ld): No such process\n", id);
+	}
+	return job;
+}
+
 /* pid2jid - Map process ID to job ID */
 int pid2jid(pid_t pid)
 {
@@ -791,10 +1278,12 @@ int pid2jid(pid_t pid)
 	return 0;
 }
 
-/* listjobs - Print the job list */
-void listjobs(struct job_t *jobs)
+/* listjobs - Print the job list, lflag adds process count and CPU time */
+void listjobs(struct job_t *jobs, int lflag)
 {
-	int i;
+	int i, j, n;
+	long cpu;
+	static struct proc_t tree[MAXTREE];
 
 	for (i = 0; i < MAXJOBS; i++)
 	{
@@ -816,14 +1305,474 @@ void listjobs(struct job_t *jobs)
 					printf("listjobs: Internal error: job[%d].state=%d ",
 					       i, jobs[i].state);
 			}
+			if (lflag)
+			{
+				// Live processes from /proc plus the ones already reaped
+				n = scantree(&jobs[i], tree, MAXTREE);
+				cpu = jobs[i].cputime;
+				for (j = 0; j < n; j++)
+				{
+					cpu += tree[j].ticks * 1000000 / sysconf(_SC_CLK_TCK);
+				}
+				printf("%d procs %ld.%02lds ", n, cpu / 1000000, cpu / 10000 % 100);
+			}
 			printf("%s", jobs[i].cmdline);
 		}
 	}
 }
+/* finishjob - The whole tree of job is gone, report it and delete it */
+void finishjob(struct job_t *job, int status)
+{
+	pid_t pid = job->pid;
+
+	// If user hits ctrl+c or the process terminates suddenly
+	// we should print it out and delete the job
+	if (WIFSIGNALED(status))
+	{
+		printf("Job [%d] (%d) terminated by signal %d\n", job->jid, pid, WTERMSIG(status));
+		fflush(stdout);
+	}
+	deletejob(jobs, pid); // Remove job from the jobs list
+	nodereaped(pid, status); // Start or cancel its dependents
+}
+
+/* checktrees - Finish every job whose leader and descendants are all gone */
+void checktrees(void)
+{
+	int i;
+
+	for (i = 0; i < MAXJOBS; i++)
+	{
+		if (jobs[i].pid != 0 && jobs[i].reaped && kill(-jobs[i].pid, 0) < 0)
+		{
+			finishjob(&jobs[i], jobs[i].status);
+		}
+	}
+}
 /******************************
  * end job list helper routines
  ******************************/
 
+/**********************************************
+ * Helper routines that walk the process trees
+ **********************************************/
+
+/*
+ * readstat - Read pid, ppid, pgid and CPU ticks of process pid from
+ *    /proc, returns 0 if it is gone. Only uses async-signal-safe calls
+ *    since the SIGCHLD handler needs it.
+ */
+int readstat(pid_t pid, struct proc_t *proc)
+{
+	char path[32], buf[512], *p;
+	char digits[16];
+	int fd, n, i, field;
+	long val;
+
+	// Build "/proc/<pid>/stat" by hand
+	strcpy(path, "/proc/");
+	for (n = 0, val = pid; n == 0 || val > 0; val /= 10)
+	{
+		digits[n++] = '0' + val % 10;
+	}
+	for (i = strlen(path); n > 0; i++)
+	{
+		path[i] = digits[--n];
+	}
+	strcpy(&path[i], "/stat");
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+	{
+		return 0;
+	}
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+	{
+		return 0;
+	}
+	buf[n] = '\0';
+
+	// The command name may hold anything, the fields follow its last ')'
+	if ((p = strrchr(buf, ')')) == NULL)
+	{
+		return 0;
+	}
+	proc->pid = pid;
+	proc->ticks = 0;
+	for (field = 2; *p; field++)
+	{
+		while (*p && *p != ' ')
+		{
+			p++;
+		}
+		while (*p == ' ')
+		{
+			p++;
+		}
+		for (val = 0; isdigit(*p); p++)
+		{
+			val = val * 10 + *p - '0';
+		}
+		switch (field + 1)
+		{
+			case 4:   /* ppid */
+				proc->ppid = val;
+				break;
+			case 5:   /* pgrp */
+				proc->pgid = val;
+				break;
+			case 14:  /* utime */
+			case 15:  /* stime */
+			case 16:  /* cutime */
+			case 17:  /* cstime */
+				proc->ticks += val;
+				break;
+		}
+		if (field + 1 == 17)
+		{
+			break;
+		}
+	}
+	return 1;
+}
+
+/*
+ * scantree - Fill tree with the live processes of job, that is its
+ *    process group and every descendant of it. Returns the count.
+ */
+int scantree(struct job_t *job, struct proc_t *tree, int max)
+{
+	static struct proc_t *procs; // every process on the system
+	static int size;
+	DIR *dir;
+	struct dirent *de;
+	int i, j, n = 0, changed;
+
+	if ((dir = opendir("/proc")) == NULL)
+	{
+		return 0;
+	}
+	while ((de = readdir(dir)) != NULL)
+	{
+		if (!isdigit(de->d_name[0]))
+		{
+			continue;
+		}
+		if (n == size)
+		{
+			size = size ? 2 * size : 256;
+			if ((procs = realloc(procs, size * sizeof(struct proc_t))) == NULL)
+			{
+				unix_error("realloc error");
+			}
+		}
+		if (readstat(atoi(de->d_name), &procs[n]))
+		{
+			procs[n].intree = (procs[n].pgid == job->pid);
+			n++;
+		}
+	}
+	closedir(dir);
+
+	// Pull in descendants that moved to a process group of their own
+	do
+	{
+		changed = 0;
+		for (i = 0; i < n; i++)
+		{
+			for (j = 0; !procs[i].intree && j < n; j++)
+			{
+				if (procs[j].intree && procs[j].pid == procs[i].ppid)
+				{
+					procs[i].intree = changed = 1;
+				}
+			}
+		}
+	}
+	while (changed);
+
+	for (i = 0, j = 0; i < n && j < max; i++)
+	{
+		if (procs[i].intree)
+		{
+			tree[j++] = procs[i];
+		}
+	}
+	return j;
+}
+
+/* killtree - Send sig to every process in the tree of job */
+void killtree(struct job_t *job, int sig)
+{
+	static struct proc_t tree[MAXTREE];
+	int i, n;
+
+	// The process group covers everything that did not leave it
+	kill(-job->pid, sig);
+
+	n = scantree(job, tree, MAXTREE);
+	for (i = 0; i < n; i++)
+	{
+		if (tree[i].pgid != job->pid)
+		{
+			kill(tree[i].pid, sig);
+		}
+	}
+}
+/**********************************
+ * end process tree helper routines
+ **********************************/
+
+/********************************************************
+ * Helper routines that manipulate the dependency graph.
+ * The caller must have SIGCHLD blocked (or be the
+ * SIGCHLD handler) since the handler drives the graph.
+ ********************************************************/
+
+/* addnode - Add a node for command argv (NULL if phony), returns its index */
+int addnode(char *name, char **argv)
+{
+	int i, j;
+
+	for (i = 0; i < MAXNODES; i++)
+	{
+		if (nodes[i].state == NFREE && nodes[i].pid == 0)
+		{
+			// pid -1 keeps the node claimed until the caller moves it
+			// to NWAIT (or NJOB) so two nodes can be built at once.
+			nodes[i].nwait = 0;
+			for (j = 0; j < MAXPREREQ; j++)
+			{
+				nodes[i].pre[j] = -1;
+			}
+			strncpy(nodes[i].name, name, MAXNAME - 1);
+			nodes[i].name[MAXNAME - 1] = '\0';
+			nodes[i].pid = -1;
+			setnodeargv(i, argv);
+			return i;
+		}
+	}
+	printf("Tried to create too many dependency nodes\n");
+	return -1;
+}
+
+/* setnodeargv - Copy argv into node's own storage and build its cmdline */
+void setnodeargv(int node, char **argv)
+{
+	struct node_t *n = &nodes[node];
+	char *buf = n->buf;
+	int i, len;
+
+	n->cmdline[0] = '\0';
+	n->argv[0] = NULL;
+	for (i = 0; argv != NULL && argv[i] != NULL && i < MAXARGS - 1; i++)
+	{
+		len = strlen(argv[i]);
+		if (buf + len + 1 > n->buf + MAXLINE ||
+		    strlen(n->cmdline) + len + 2 >= MAXLINE)
+		{
+			break;
+		}
+		strcpy(buf, argv[i]);
+		n->argv[i] = buf;
+		buf += len + 1;
+		if (i > 0)
+		{
+			strcat(n->cmdline, " ");
+		}
+		strcat(n->cmdline, argv[i]);
+	}
+	n->argv[i] = NULL;
+	if (i > 0)
+	{
+		strcat(n->cmdline, "\n");
+	}
+}
+
+/* watchjob - Return the node that tracks the running job pid */
+int watchjob(pid_t pid)
+{
+	int i, node;
+
+	for (i = 0; i < MAXNODES; i++)
+	{
+		if (nodes[i].state == NJOB && nodes[i].pid == pid)
+		{
+			return i;
+		}
+	}
+	if ((node = addnode("", NULL)) >= 0)
+	{
+		nodes[node].state = NJOB;
+		nodes[node].pid = pid;
+	}
+	return node;
+}
+
+/* addprereq - Make node wait for node pre, returns 0 if node is full */
+int addprereq(int node, int pre)
+{
+	int i;
+
+	if (node < 0 || pre < 0)
+	{
+		return 0;
+	}
+	for (i = 0; i < MAXPREREQ; i++)
+	{
+		if (nodes[node].pre[i] == -1)
+		{
+			nodes[node].pre[i] = pre;
+			nodes[node].nwait++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* freenode - Clear the entries in a node */
+void freenode(int node)
+{
+	nodes[node].state = NFREE;
+	nodes[node].pid = 0;
+	nodes[node].nwait = 0;
+	nodes[node].name[0] = '\0';
+	nodes[node].cmdline[0] = '\0';
+	nodes[node].argv[0] = NULL;
+}
+
+/* startnode - Fork and exec the command of node as a BG job */
+void startnode(int node)
+{
+	struct node_t *n = &nodes[node];
+	pid_t pid;
+	sigset_t mask;
+
+	if ((pid = fork()) < 0)
+	{
+		printf("Error forking child process\n");
+		finishnode(node, 0);
+		return;
+	}
+	if (pid == 0)
+	{
+		// Same as eval(), but we may be running inside the SIGCHLD
+		// handler so the child has to unblock everything itself.
+		setpgid(0, 0);
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		if (execve(n->argv[0], n->argv, environ) < 0)
+		{
+			printf("%s: Command not found\n", n->argv[0]);
+			fflush(stdout);
+			exit(1); // counts as a failure for the dependents
+		}
+	}
+
+	n->state = NRUN;
+	n->pid = pid;
+	if (addjob(jobs, pid, BG, n->cmdline))
+	{
+		printf("[%d] (%d) %s", pid2jid(pid), pid, n->cmdline);
+		fflush(stdout);
+	}
+}
+
+/* finishnode - Free node and release (ok) or cancel (!ok) its dependents */
+void finishnode(int node, int ok)
+{
+	int i, j;
+
+	// Freed first, so a cycle can not bring us back here
+	freenode(node);
+
+	for (i = 0; i < MAXNODES; i++)
+	{
+		if (nodes[i].state != NWAIT)
+		{
+			continue;
+		}
+		for (j = 0; j < MAXPREREQ; j++)
+		{
+			if (nodes[i].pre[j] != node)
+			{
+				continue;
+			}
+			nodes[i].pre[j] = -1;
+			nodes[i].nwait--;
+			if (!ok)
+			{
+				if (nodes[i].name[0] != '\0')
+				{
+					printf("%s: cancelled, prerequisite failed\n", nodes[i].name);
+				}
+				else
+				{
+					printf("Cancelled %s", nodes[i].cmdline);
+				}
+				fflush(stdout);
+				finishnode(i, 0);
+				break;
+			}
+		}
+	}
+}
+
+/* schedulenodes - Start every ready node while there are free slots */
+void schedulenodes(void)
+{
+	int i, running;
+
+	running = 0;
+	for (i = 0; i < MAXNODES; i++)
+	{
+		if (nodes[i].state == NRUN)
+		{
+			running++;
+		}
+	}
+
+	for (i = 0; i < MAXNODES; i++)
+	{
+		if (nodes[i].state != NWAIT || nodes[i].nwait != 0)
+		{
+			continue;
+		}
+		if (nodes[i].argv[0] == NULL)
+		{
+			// A phony target is done as soon as it is ready,
+			// which may release nodes we already passed.
+			finishnode(i, 1);
+			i = -1;
+		}
+		else if (running < dagslots)
+		{
+			startnode(i);
+			running++;
+		}
+	}
+}
+
+/* nodereaped - Called for every reaped pid to drive the dependency graph */
+void nodereaped(pid_t pid, int status)
+{
+	int i;
+
+	for (i = 0; i < MAXNODES; i++)
+	{
+		if ((nodes[i].state == NRUN || nodes[i].state == NJOB) && nodes[i].pid == pid)
+		{
+			finishnode(i, WIFEXITED(status) && WEXITSTATUS(status) == 0);
+			schedulenodes();
+			return;
+		}
+	}
+}
+/*************************************
+ * end dependency graph helper routines
+ *************************************/
+
 
 /***********************
  * Other helper routines
@@ -834,10 +1783,11 @@ void listjobs(struct job_t *jobs)
  */
 void usage(void)
 {
-	printf("Usage: shell [-hvp]\n");
+	printf("Usage: shell [-hvps]\n");
 	printf("   -h   print this message\n");
 	printf("   -v   print additional diagnostic information\n");
 	printf("   -p   do not emit a command prompt\n");
+	printf("   -s   adopt orphaned descendants of jobs (subreaper)\n");
 	exit(1);
 }
 